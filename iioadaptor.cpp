@@ -25,8 +25,10 @@
    </p>
 */
 #include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
 
-#include <iio.h>
 #include <libudev.h>
 
 #include <logging.h>
@@ -34,8 +36,16 @@
 #include <datatypes/utils.h>
 #include <unistd.h>
 #include <time.h>
+#include <signal.h>
+#include <sys/utsname.h>
 
 #include "iioadaptor.h"
+#include "iiosamplesink.h"
+#include "iiotrace.h"
+#include "iiolayoutcache.h"
+#ifdef HAVE_LIBIIO
+#include "iiocontextreader.h"
+#endif
 #include <sensord-qt5/sysfsadaptor.h>
 #include <sensord-qt5/deviceadaptorringbuffer.h>
 #include <QTextStream>
@@ -91,10 +101,27 @@
 
 IioAdaptor::IioAdaptor(const QString &id/*, int type*/) :
         SysfsAdaptor(id, SysfsAdaptor::IntervalMode, true),
+        descriptor_(0),
+        sink_(0),
         deviceId(id),
-        scale(-1)
+        scale(-1),
+        frequency(0),
+        offset(0),
+        numChannels(0),
+        rawChannels_(0),
+        layoutCached_(false),
+        requestedInterval_(0),
+        pollSessionId_(0),
+        pollBase_(0),
+        pollInterval_(0),
+        quietFrames_(0),
+        pollStatsValid_(false),
+        iioReader_(0),
+        readerRestarts_(0)
 {
     //sensorType = (IioAdaptor::IioSensorType)type;
+    for (int i = 0; i < IIO_MAX_DEVICE_CHANNELS; ++i)
+        rawFds_[i] = -1;
 
     sensordLogD() << "Creating IioAdaptor with id: " << id;
 //    QTimer::singleShot(100, this,SLOT(setup()));
@@ -103,57 +130,53 @@ IioAdaptor::IioAdaptor(const QString &id/*, int type*/) :
 
 IioAdaptor::~IioAdaptor()
 {
-    if (iioXyzBuffer_)
-        delete iioXyzBuffer_;
-    if (alsBuffer_)
-        delete alsBuffer_;
-    if (magnetometerBuffer_)
-        delete magnetometerBuffer_;
+#ifdef HAVE_LIBIIO
+    delete iioReader_;
+#endif
+    if (sink_)
+        sink_->saveState(statePath());
+    delete sink_;
+    closeRawChannels();
 }
 
 void IioAdaptor::setup()
 {
-    if (deviceId.startsWith("accel")) {
-        dev_accl_ = sensorExists(IioAdaptor::IIO_ACCELEROMETER);
-        if (dev_accl_!= -1) {
-            sensorType = IioAdaptor::IIO_ACCELEROMETER;
-            iioXyzBuffer_ = new DeviceAdaptorRingBuffer<TimedXyzData>(1);
-            QString desc = "Industrial I/O accelerometer (" +  devices_[dev_accl_].name +")";
-            qWarning() << Q_FUNC_INFO << "Accelerometer found";
-            setAdaptedSensor("accelerometer", desc, iioXyzBuffer_);
-            setDescription(desc);
-        }
-    }
-    else if (deviceId.startsWith("gyro")) {
-        dev_accl_ = sensorExists(IIO_GYROSCOPE);
-        if (dev_accl_!= -1) {
-            sensorType = IioAdaptor::IIO_GYROSCOPE;
-            iioXyzBuffer_ = new DeviceAdaptorRingBuffer<TimedXyzData>(1);
-            QString desc = "Industrial I/O gyroscope (" +  devices_[dev_accl_].name +")";
-            setAdaptedSensor("gyroscope", desc, iioXyzBuffer_);
-            setDescription(desc);
-        }
+#ifdef HAVE_LIBIIO
+    if (Config::configuration()->value<QString>("iio/backend", "sysfs") == QLatin1String("libiio")) {
+        iioReader_ = new IioContextReader(this);
+        iioReader_->setBufferSamples(Config::configuration()->value<unsigned int>("iio/buffer_samples", IIO_BUFFER_LEN));
+        connect(iioReader_, SIGNAL(readFailed(int,bool)), this, SLOT(restartReader(int,bool)));
     }
-    else if (deviceId.startsWith("mag")) {
-        dev_accl_ = sensorExists(IIO_MAGNETOMETER);
-        if (dev_accl_!= -1) {
-            sensorType = IioAdaptor::IIO_MAGNETOMETER;
-            magnetometerBuffer_ = new DeviceAdaptorRingBuffer<CalibratedMagneticFieldData>(1);
-            QString desc = "Industrial I/O magnetometer (" +  devices_[dev_accl_].name +")";
-            setAdaptedSensor("magnetometer", desc, magnetometerBuffer_);
-            //        overflowLimit_ = Config::configuration()->value<int>("magnetometer/overflow_limit", 8000);
-            setDescription(desc);
+#endif
+
+    adaptivePolling_ = Config::configuration()->value<bool>("iio/adaptive_polling", false);
+    adaptiveThreshold_ = Config::configuration()->value<double>("iio/adaptive_threshold", 4.0);
+    adaptiveStep_ = Config::configuration()->value<double>("iio/adaptive_step", 16.0);
+    adaptiveMaxInterval_ = Config::configuration()->value<unsigned int>("iio/adaptive_max_interval", 1000);
+
+    QString traceFile = Config::configuration()->value<QString>("iio/state_dir", "/var/lib/sensord") + "/iio-trace";
+    IioTrace::installDumpSignal(Config::configuration()->value<int>("iio/trace_signal", SIGRTMIN + 2),
+                                Config::configuration()->value<QString>("iio/trace_file", traceFile));
+
+    dev_accl_ = -1;
+    for (int i = 0; i < sensorDescriptorCount_; ++i) {
+        if (deviceId.startsWith(QLatin1String(sensorDescriptors_[i].idPrefix))) {
+            dev_accl_ = sensorExists(sensorDescriptors_[i].type);
+            break;
         }
     }
-    else if (deviceId.startsWith("als")) {
-        dev_accl_ = sensorExists(IIO_ALS);
-        if (dev_accl_!= -1) {
-            sensorType = IioAdaptor::IIO_ALS;
-            alsBuffer_ = new DeviceAdaptorRingBuffer<TimedUnsigned>(1);
-            QString desc = "Industrial I/O light sensor (" +  devices_[dev_accl_].name +")";
-            setDescription(desc);
-            setAdaptedSensor("als", desc, alsBuffer_);
-        }
+
+    if (dev_accl_ != -1) {
+        // libiio hands over a block of frames per refill, the ring has
+        // to hold all of them until readers are woken
+        sink_ = descriptor_->createSink(iioReader_ ? iioReader_->bufferSamples() : 1);
+        setupConversion();
+        sink_->loadState(statePath());
+        QString desc = QString::fromLatin1(descriptor_->description)
+                + " (" + devices_[dev_accl_].name + ")";
+        qWarning() << Q_FUNC_INFO << descriptor_->sensorName << "found";
+        setAdaptedSensor(descriptor_->sensorName, desc, sink_->buffer());
+        setDescription(desc);
     }
 
     qWarning() << Q_FUNC_INFO << dev_accl_;
@@ -165,12 +188,14 @@ void IioAdaptor::setup()
 //        setAdaptedSensor("accelerometer", desc, iioBuffer_);
 //    }
 
-    // Disable and then enable devices to make sure they allow changing settings
-//    for (i = 0; i < IIO_MAX_DEVICES; ++i) {
-//        if (dev_accl_ == i || dev_gyro_ == i || dev_magn_ == i) {
-    deviceEnable(dev_accl_, false);
-    deviceEnable(dev_accl_, true);
-//    }
+    // Leave the buffer and scan elements off until a session starts,
+    // this also probes the scan elements.
+    if (dev_accl_ != -1)
+        deviceEnable(dev_accl_, false);
+
+    if (dev_accl_ != -1 && !iioReader_ && !layoutCached_)
+        IioLayoutCache(layoutCachePath()).store(layout_);
+
     introduceAvailableDataRange(DataRange(0, 65535, 1));
     introduceAvailableInterval(DataRange(0, 586, 0));
     setDefaultInterval(10);
@@ -210,12 +235,27 @@ int IioAdaptor::findSensor(const QString &sensorName)
 
             if (name == sensorName) {
                 struct udev_list_entry *sysattr;
-                int j = 0;
                 QString eventName = QString::fromLatin1(udev_device_get_sysname(dev));
                 devicePath = QString::fromLatin1(udev_device_get_syspath(dev)) +"/";
                 index = eventName.right(1).toInt(&ok2);
                 //qWarning() << Q_FUNC_INFO << "syspath" << devicePath;
 
+                layout_.identity = deviceIdentity(dev, descriptor_->sensorName);
+                IioLayoutCache cache(layoutCachePath());
+                if (cache.load(layout_.identity, devicePath, &layout_)) {
+                    sensordLogD() << "Using cached layout for" << devicePath;
+                    if (applyLayout())
+                        layoutCached_ = true;
+                    else
+                        ok2 = false;
+                    break;
+                }
+                layout_.rawChannels.clear();
+                layout_.scanElements.clear();
+                layout_.mountMatrix.clear();
+                layout_.scaleAttribute.clear();
+                layout_.offsetAttribute.clear();
+
                 udev_list_entry_foreach(sysattr, udev_device_get_sysattr_list_entry(dev)) {
                     const char *name;
                     const char *value;
@@ -228,34 +268,49 @@ int IioAdaptor::findSensor(const QString &sensorName)
                     qWarning() << "attr" << name << value;
 
                     QString attributeName(name);
-                    if (attributeName.endsWith("scale")) {
+                    if (attributeName == QLatin1String("mount_matrix")) {
+                        // device wide, a channel group one takes precedence
+                        if (hasMountMatrix() && layout_.mountMatrix.isEmpty())
+                            layout_.mountMatrix = QString::fromLatin1(value);
+                    } else if (attributeName.endsWith("frequency")) {
+                        double num = QString(value).toDouble(&ok);
+                        if (ok)
+                            frequency = num;
+                        qWarning() << "frequency is" << value;
+                    } else if (!channelWanted(attributeName)) {
+                        // belongs to another channel group of a combo device
+                        continue;
+                    } else if (attributeName.endsWith("mount_matrix")) {
+                        if (!hasMountMatrix())
+                            continue;
+                        layout_.mountMatrix = QString::fromLatin1(value);
+                        qWarning() << "mount matrix is" << value;
+                    } else if (attributeName.endsWith("scale")) {
                         double num = QString(value).toDouble(&ok);
                         if (ok) {
                             scale = num;
+                            layout_.scaleAttribute = attributeName;
                             qWarning() << "scale is" << scale;
                         }
                     } else if (attributeName.endsWith("offset")) {
                         double num = QString(value).toDouble(&ok);
-                        if (ok)
+                        if (ok) {
                             offset = num;
+                            layout_.offsetAttribute = attributeName;
+                        }
                         qWarning() << "offset is" << value;
-                    } else if (attributeName.endsWith("frequency")) {
-                        double num = QString(value).toDouble(&ok);
-                        if (ok)
-                            frequency = num;
-                        qWarning() << "frequency is" << value;
                     } else if (attributeName.endsWith("raw")) {
                         qWarning() << "adding to paths:" << devicePath
                                    << attributeName << index;
 
-                        addPath(devicePath + attributeName, j);
-                        j++;
+                        layout_.rawChannels << attributeName;
                     }
                 }
-
-    // in_rot_from_north_magnetic_tilt_comp_raw ?
-
-                // type
+                layout_.scale = scale;
+                layout_.offset = offset;
+                layout_.frequency = frequency;
+                if (!applyLayout())
+                    ok2 = false;
                 break;
             }
         }
@@ -268,50 +323,174 @@ int IioAdaptor::findSensor(const QString &sensorName)
     else
         return -1;
 }
+
+// Stable across boots, unlike the iio:deviceX number. The kernel
+// release is part of it since a new driver may lay out channels
+// differently.
+QString IioAdaptor::deviceIdentity(struct udev_device *dev, const char *sensor)
+{
+    struct udev_device *parent = udev_device_get_parent(dev);
+    struct utsname uts;
+    QStringList parts;
+
+    parts << QString::fromLatin1(sensor)
+          << QString::fromLatin1(udev_device_get_sysattr_value(dev, "name"));
+    if (uname(&uts) == 0)
+        parts << QString::fromLatin1(uts.release);
+    if (parent) {
+        parts << QString::fromLatin1(udev_device_get_sysattr_value(parent, "modalias"))
+              << QString::fromLatin1(udev_device_get_syspath(parent));
+    }
+
+    return parts.join(QLatin1Char('|'));
+}
+
+QString IioAdaptor::layoutCachePath() const
+{
+    return Config::configuration()->value<QString>("iio/layout_cache", "/var/cache/sensord/iio-layout.ini");
+}
+
 /*
- * als
- * accel_3d
- * gyro_3d
- * magn_3d
- * incli_3d
- * dev_rotation
- *
- * */
+ * Pick the raw channels a sink consumes, in frame order. Three axis
+ * sinks take the _x, _y and _z channels by suffix; anything else (or
+ * a device naming its axes differently) takes the first channels by
+ * name, as sysattr order is arbitrary.
+ */
+static QStringList polledChannels(const QStringList &rawChannels, int count)
+{
+    QStringList polled;
+
+    if (count == 3) {
+        static const char *const suffixes[] = { "_x_raw", "_y_raw", "_z_raw" };
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int i = 0; i < rawChannels.size(); ++i) {
+                if (rawChannels.at(i).endsWith(QLatin1String(suffixes[axis]))) {
+                    polled << rawChannels.at(i);
+                    break;
+                }
+            }
+        }
+        if (polled.size() == 3)
+            return polled;
+        polled.clear();
+    }
+
+    polled = rawChannels;
+    polled.sort();
+    return polled.mid(0, count);
+}
+
+bool IioAdaptor::applyLayout()
+{
+    scale = layout_.scale;
+    offset = layout_.offset;
+    frequency = layout_.frequency;
+
+    // Only the first channel is handed to SysfsAdaptor, so each poll
+    // tick is a single processSample() call. The other channels are
+    // read from fds kept open for the lifetime of the adaptor.
+    closeRawChannels();
+    QStringList polled = polledChannels(layout_.rawChannels,
+                                        qMin(descriptor_->channels, IIO_MAX_DEVICE_CHANNELS));
+    int channels = polled.size();
+    rawChannels_ = 0;
+    if (channels == 0)
+        return false;
+
+    // Frame values map to axes by position, so a device with a channel
+    // that cannot be opened is not used at all.
+    for (int j = 1; j < channels; ++j) {
+        QByteArray path = QString(devicePath + polled.at(j)).toLocal8Bit();
+        rawFds_[j] = ::open(path.constData(), O_RDONLY | O_CLOEXEC);
+        if (rawFds_[j] < 0) {
+            sensordLogW() << "open(" << path << "):" << strerror(errno);
+            closeRawChannels();
+            return false;
+        }
+    }
+
+    addPath(devicePath + polled.at(0), 0);
+    rawChannels_ = channels;
+    return true;
+}
+
+void IioAdaptor::closeRawChannels()
+{
+    for (int j = 0; j < IIO_MAX_DEVICE_CHANNELS; ++j) {
+        if (rawFds_[j] >= 0)
+            ::close(rawFds_[j]);
+        rawFds_[j] = -1;
+    }
+}
+const IioAdaptor::SensorDescriptor IioAdaptor::sensorDescriptors_[] = {
+    { "accel", IioAdaptor::IIO_ACCELEROMETER, "accel_3d", { "in_accel_", 0 },
+      "accelerometer", "Industrial I/O accelerometer", createIioFrameSink<TimedXyzData>,
+      IioFrameTraits<TimedXyzData>::Channels },
+    { "gyro", IioAdaptor::IIO_GYROSCOPE, "gyro_3d", { "in_anglvel_", 0 },
+      "gyroscope", "Industrial I/O gyroscope", createIioFrameSink<TimedXyzData>,
+      IioFrameTraits<TimedXyzData>::Channels },
+    { "mag", IioAdaptor::IIO_MAGNETOMETER, "magn_3d", { "in_magn_", 0 },
+      "magnetometer", "Industrial I/O magnetometer", createIioFrameSink<CalibratedMagneticFieldData>,
+      IioFrameTraits<CalibratedMagneticFieldData>::Channels },
+    { "als", IioAdaptor::IIO_ALS, "als", { "in_illuminance", "in_intensity" },
+      "als", "Industrial I/O light sensor", createIioFrameSink<TimedUnsigned>,
+      IioFrameTraits<TimedUnsigned>::Channels }
+    // in_rot_from_north_magnetic_tilt_comp_raw ?
+    // { "rotation", IioAdaptor::IIO_ROTATION, "dev_rotation", ... },
+    // { "tilt", IioAdaptor::IIO_TILT, "incli_3d", ... },
+};
+
+const int IioAdaptor::sensorDescriptorCount_ =
+        sizeof(IioAdaptor::sensorDescriptors_) / sizeof(IioAdaptor::sensorDescriptors_[0]);
+
 int IioAdaptor::sensorExists(IioAdaptor::IioSensorType sensor)
 {
-    QString sensorName;
-    switch (sensor) {
-    case IIO_ACCELEROMETER:
-        sensorName = QStringLiteral("accel_3d");
-        break;
-    case IIO_GYROSCOPE:
-        sensorName = QStringLiteral("gyro_3d");
-        break;
-    case IIO_MAGNETOMETER:
-        sensorName = QStringLiteral("magn_3d");
-        break;
-    case IIO_ALS:
-        sensorName = QStringLiteral("als");
-        break;
-        /*
-          case IIO_ROTATION:
-        sensorName = QStringLiteral("dev_rotation");
-          case IIO_TILT:
-        sensorName = QStringLiteral("incli_3d");
-        */
-    default:
-        return -1;
+    // channelWanted() needs to know the type while probing
+    sensorType = sensor;
+    descriptor_ = 0;
+    for (int i = 0; i < sensorDescriptorCount_; ++i) {
+        if (sensorDescriptors_[i].type == sensor) {
+            descriptor_ = &sensorDescriptors_[i];
+            break;
+        }
     }
-    if (!sensorName.isEmpty())
-        return findSensor(sensorName);
-    else
+    if (!descriptor_)
+        return -1;
+
+    QString sensorName = QString::fromLatin1(descriptor_->iioName);
+    if (sensorName.isEmpty())
         return -1;
+
+#ifdef HAVE_LIBIIO
+    if (iioReader_) {
+        QString uri = Config::configuration()->value<QString>("iio/context_uri", QString());
+        if (iioReader_->open(uri, sensorName)) {
+            devices_[0].name = sensorName;
+            scale = iioReader_->channelScale();
+            if (scale <= 0)
+                scale = 1;
+            offset = iioReader_->channelOffset();
+            if (hasMountMatrix())
+                layout_.mountMatrix = iioReader_->channelAttribute("mount_matrix");
+            return 0;
+        }
+        sensordLogW() << "libiio backend has no" << sensorName << ", falling back to sysfs";
+        delete iioReader_;
+        iioReader_ = 0;
+    }
+#endif
+
+    return findSensor(sensorName);
 }
 
 bool IioAdaptor::deviceEnable(int device, int enable)
 {
     qWarning() << Q_FUNC_INFO << device << enable;
 
+    // libiio handles the buffer and scan elements itself
+    if (iioReader_)
+        return true;
+
     QString pathEnable = devicePath + "buffer/enable";
     QString pathLength = devicePath + "buffer/length";
 
@@ -391,8 +570,37 @@ int IioAdaptor::sysfsReadInt(QString filename)
 	return value;
 }
 
-// Return the number of channels
+// Return the number of enabled data channels, not counting the timestamp
 int IioAdaptor::scanElementsEnable(int device, int enable)
+{
+    if (layout_.scanElements.isEmpty() && !probeScanElements())
+        return 0;
+
+    // Only the channels this sensor type consumes get a 1, everything
+    // else on a combo device is turned off so it does not bloat the
+    // scan frame.
+    int enabled = 0;
+    QString elementsPath = devicePath + "scan_elements/";
+    for (int i = 0; i < layout_.scanElements.size(); ++i) {
+        const iio_scan_element &element = layout_.scanElements.at(i);
+
+        bool wanted = enable && element.index >= 0;
+        if (wanted) {
+            if (element.index < IIO_MAX_DEVICE_CHANNELS)
+                devices_[device].channel_bytes[element.index] = element.bytes;
+            if (!element.name.startsWith(QLatin1String("in_timestamp")))
+                enabled++;
+        }
+
+        sysfsWriteInt(elementsPath + element.name + "_en", wanted);
+    }
+qWarning() << Q_FUNC_INFO << layout_.scanElements.size() << enabled;
+
+    return enabled;
+}
+
+// Read index and type of the scan elements this sensor type consumes
+bool IioAdaptor::probeScanElements()
 {
     QString elementsPath = devicePath + "scan_elements";
 
@@ -401,10 +609,9 @@ int IioAdaptor::scanElementsEnable(int device, int enable)
     QDir dir(elementsPath);
     if (!dir.exists()) {
         sensordLogW() << "Directory " << elementsPath << " doesn't exist";
-        return 0;
+        return false;
     }
 
-    // Find all the *_en file and write 0/1 to it
     QStringList filters;
     filters << "*_en";
     dir.setNameFilters(filters);
@@ -412,26 +619,42 @@ int IioAdaptor::scanElementsEnable(int device, int enable)
     QFileInfoList list = dir.entryInfoList();
     for (int i = 0; i < list.size(); ++i) {
         QFileInfo fileInfo = list.at(i);
+        QString base = fileInfo.filePath();
+        // Remove the _en
+        base.chop(3);
+
+        iio_scan_element element;
+        element.name = fileInfo.fileName();
+        element.name.chop(3);
+        element.index = -1;
+        element.bytes = 0;
+
+        if (channelWanted(fileInfo.fileName())) {
+            element.index = sysfsReadInt(base + "_index");
+            element.bytes = deviceChannelParseBytes(base + "_type");
+        }
+        layout_.scanElements << element;
+    }
 
-        if (enable) {
-            QString base = fileInfo.filePath();
-            // Remove the _en
-            base.chop(3);
+    return !layout_.scanElements.isEmpty();
+}
 
-            int index = sysfsReadInt(base + "_index");
-            int bytes = deviceChannelParseBytes(base + "_type");
+bool IioAdaptor::channelWanted(const QString &channel) const
+{
+    if (channel.startsWith(QLatin1String("in_timestamp")))
+        return true;
 
-            devices_[device].channel_bytes[index] = bytes;
-        }
+    if (!descriptor_)
+        return false;
 
-        sysfsWriteInt(fileInfo.filePath(), enable);
+    for (int i = 0; i < 2; ++i) {
+        const char *prefix = descriptor_->channelPrefixes[i];
+        if (prefix && channel.startsWith(QLatin1String(prefix)))
+            return true;
     }
-qWarning() << Q_FUNC_INFO << list.size();
-
-    return list.size();
+    return false;
 }
 
-
 int IioAdaptor::deviceChannelParseBytes(QString filename)
 {
     QString type = sysfsReadString(filename);
@@ -451,127 +674,236 @@ int IioAdaptor::deviceChannelParseBytes(QString filename)
 
 void IioAdaptor::processSample(int fileId, int fd)
 {
-    char buf[256];
-    int readBytes;
-    int result;
+    char buf[32];
+    ssize_t readBytes;
     int channel = fileId%IIO_MAX_DEVICE_CHANNELS;
     int device = (fileId - channel)/IIO_MAX_DEVICE_CHANNELS;
 
-    qWarning() << Q_FUNC_INFO << "fileId" << fileId << "channel" << channel << "device" << device;
+    if (device != 0 || channel != 0)
+        return;
 
-    if (device == 0) {
-        readBytes = read(fd, buf, sizeof(buf));
+    // Read every polled channel back to back so the frame is coherent
+    for (int i = 0; i < rawChannels_; ++i) {
+        readBytes = pread(i == 0 ? fd : rawFds_[i], buf, sizeof(buf) - 1, 0);
 
         if (readBytes <= 0) {
-            sensordLogW() << "read():" << strerror(errno);
+            IioTrace::record(IioTrace::Error, dev_accl_, i, readBytes < 0 ? errno : 0);
+            sensordLogW() << "pread():" << strerror(errno);
             return;
         }
+        IioTrace::record(IioTrace::Read, dev_accl_, i, readBytes);
 
-        result = atoi(buf);
+        buf[readBytes] = '\0';
+        frame_.values[i] = strtol(buf, NULL, 10);
+    }
 
-        qWarning() << "Read " << result
-                   << " from device " << device
-                   << ", channel " << channel;
+    IioTrace::record(IioTrace::Decode, dev_accl_, 0, rawChannels_);
+    frame_.count = rawChannels_;
+    frame_.timestamp = Utils::getTimeStamp();
+    adaptPollInterval(frame_);
+    commitFrame(frame_);
+    wakeUpReaders();
+}
 
-        switch(channel) {
-        case 0: { //x
-            switch (sensorType) {
-            case IioAdaptor::IIO_ACCELEROMETER:
-            case IioAdaptor::IIO_GYROSCOPE:
-                timedData = iioXyzBuffer_->nextSlot();
-                result = (result * scale) * 100;
-                timedData->x_= -result;
-                break;
-            case IioAdaptor::IIO_MAGNETOMETER:
-                calData = magnetometerBuffer_->nextSlot();
-                result = (result * scale) * 100;
-                calData->rx_ = result;
-                break;
-            case IioAdaptor::IIO_ALS:
-                uData = alsBuffer_->nextSlot();
-                result = (result * scale);
-                uData->value_ = result;
-                qWarning() << "ALS" << result << uData->value_;
-                break;
-            default:
-                break;
-            };
-        }
-            break;
+// "x1, y1, z1; x2, y2, z2; x3, y3, z3" as in the IIO mount_matrix ABI
+static bool parseMountMatrix(const QString &text, double matrix[3][3])
+{
+    QStringList rows = text.split(QLatin1Char(';'));
+    if (rows.size() != 3)
+        return false;
 
-        case 1: { //y
-            switch (sensorType) {
-            case IioAdaptor::IIO_ACCELEROMETER:
-            case IioAdaptor::IIO_GYROSCOPE:
-                timedData = iioXyzBuffer_->nextSlot();
-                result = (result * scale) * 100;
-                timedData->y_ = -result;
-                break;
-            case IioAdaptor::IIO_MAGNETOMETER:
-                calData = magnetometerBuffer_->nextSlot();
-                result = (result * scale) * 100;
-                calData->y_ = result;
-                break;
-            default:
-                break;
-            };
+    for (int i = 0; i < 3; ++i) {
+        QStringList columns = rows.at(i).split(QLatin1Char(','));
+        if (columns.size() != 3)
+            return false;
+        for (int j = 0; j < 3; ++j) {
+            bool ok;
+            matrix[i][j] = columns.at(j).trimmed().toDouble(&ok);
+            if (!ok)
+                return false;
         }
-            break;
+    }
+    return true;
+}
 
-        case 2: {// z
-            switch (sensorType) {
-            case IioAdaptor::IIO_ACCELEROMETER:
-            case IioAdaptor::IIO_GYROSCOPE:
-                timedData = iioXyzBuffer_->nextSlot();
-                result = (result * scale) * 100;
-                timedData->z_ = -result;
-                break;
-            case IioAdaptor::IIO_MAGNETOMETER:
-                calData = magnetometerBuffer_->nextSlot();
-                result = (result * scale) * 100;
-                calData->rz_ = result;
-                break;
-            default:
-                break;
-            };
+/*
+ * Rotation comes from <sensor>/mount_matrix in the configuration, else
+ * from the driver's in_*_mount_matrix, else identity. It is folded with
+ * scale and offset into the sink's conversion, so no separate
+ * coordinate alignment pass is needed.
+ */
+void IioAdaptor::setupConversion()
+{
+    static const double identity[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+    double mount[3][3];
+
+    if (scale <= 0)
+        scale = 1;
+
+    if (!hasMountMatrix()) {
+        sink_->setConversion(identity, scale, offset);
+        return;
+    }
+
+    memcpy(mount, identity, sizeof(mount));
+
+    QString key = QString::fromLatin1(descriptor_->sensorName) + "/mount_matrix";
+    QString text = Config::configuration()->value<QString>(key, layout_.mountMatrix);
+    if (!text.isEmpty() && !parseMountMatrix(text, mount)) {
+        sensordLogW() << "Ignoring invalid mount matrix" << text;
+        memcpy(mount, identity, sizeof(mount));
+    }
+
+    // sensord's accel/gyro output has all axes inverted with respect to
+    // IIO. That is an output convention, not a mounting correction, so
+    // it is applied on top of the mount matrix: flipped x mount.
+    if (descriptor_->type == IIO_ACCELEROMETER || descriptor_->type == IIO_GYROSCOPE) {
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j)
+                mount[i][j] = -mount[i][j];
         }
-            break;
-        };
+    }
 
-        qWarning() << Q_FUNC_INFO << channel << devices_[device].channels
-                   << "numChannels" << numChannels;
+    sink_->setConversion(mount, scale, offset);
+}
 
-        if (channel == numChannels - 1) {
+bool IioAdaptor::hasMountMatrix() const
+{
+    switch (descriptor_->type) {
+    case IIO_ACCELEROMETER:
+    case IIO_GYROSCOPE:
+    case IIO_MAGNETOMETER:
+        return true;
+    default:
+        return false;
+    }
+}
 
-            switch (sensorType) {
-            case IioAdaptor::IIO_ACCELEROMETER:
-            case IioAdaptor::IIO_GYROSCOPE:
-                timedData->timestamp_ = Utils::getTimeStamp();
-                iioXyzBuffer_->commit();
-                iioXyzBuffer_->wakeUpReaders();
-                break;
-            case IioAdaptor::IIO_MAGNETOMETER:
-                calData->timestamp_ = Utils::getTimeStamp();
-                magnetometerBuffer_->commit();
-                magnetometerBuffer_->wakeUpReaders();
-                break;
-            case IioAdaptor::IIO_ALS:
-                uData->timestamp_ = Utils::getTimeStamp();
-                alsBuffer_->commit();
-                alsBuffer_->wakeUpReaders();
-                qWarning() << "XXXXXXXXXXXXXXX<<<<<<<<<<<<<<<>>>>>>>>>>>>>>>>>>>>>>";
-                break;
-            default:
-                break;
-            };
+QString IioAdaptor::statePath() const
+{
+    QString dir = Config::configuration()->value<QString>("iio/state_dir", "/var/lib/sensord");
+    return dir + "/iio-" + QString::fromLatin1(descriptor_ ? descriptor_->sensorName : "unknown") + ".ini";
+}
+
+/*
+ * Back off the poll interval while readings are flat. The running
+ * variance of every channel has to stay under iio/adaptive_threshold
+ * (raw counts squared) for IIO_ADAPTIVE_QUIET_FRAMES frames before the
+ * interval doubles, up to iio/adaptive_max_interval ms, which bounds
+ * how stale a reading can get. A single sample more than
+ * iio/adaptive_step raw counts from the running mean restores the
+ * requested interval.
+ *
+ * Runs on the SysfsAdaptor reader thread. All state used here is owned
+ * by that thread except requestedInterval_, which is atomic; the new
+ * interval is applied on the main thread by applyPollInterval().
+ */
+void IioAdaptor::adaptPollInterval(const IioFrame &frame)
+{
+    unsigned int requested = requestedInterval_.loadAcquire();
+    if (!adaptivePolling_ || requested == 0)
+        return;
+
+    if (requested != pollBase_) {
+        pollBase_ = requested;
+        pollInterval_ = requested;
+        quietFrames_ = 0;
+    }
+
+    bool moved = false;
+    bool flat = true;
+    for (int i = 0; i < frame.count; ++i) {
+        if (!pollStatsValid_) {
+            pollMean_[i] = frame.values[i];
+            pollVariance_[i] = 0;
+            continue;
         }
+        double delta = frame.values[i] - pollMean_[i];
+        pollMean_[i] += IIO_ADAPTIVE_ALPHA * delta;
+        pollVariance_[i] = (1 - IIO_ADAPTIVE_ALPHA) * (pollVariance_[i] + IIO_ADAPTIVE_ALPHA * delta * delta);
+        if (qAbs(delta) > adaptiveStep_)
+            moved = true;
+        if (pollVariance_[i] > adaptiveThreshold_)
+            flat = false;
+    }
+    pollStatsValid_ = true;
+
+    unsigned int next = pollInterval_;
+    if (moved) {
+        quietFrames_ = 0;
+        next = requested;
+    } else if (flat && ++quietFrames_ >= IIO_ADAPTIVE_QUIET_FRAMES) {
+        quietFrames_ = 0;
+        next = qMin(pollInterval_ * 2, qMax(adaptiveMaxInterval_, requested));
+    }
+
+    if (next != pollInterval_) {
+        pollInterval_ = next;
+        QMetaObject::invokeMethod(this, "applyPollInterval", Qt::QueuedConnection,
+                                  Q_ARG(uint, next), Q_ARG(uint, requested));
+    }
+}
+
+void IioAdaptor::applyPollInterval(uint value, uint requested)
+{
+    // Stale if a client asked for a new rate in the meantime
+    if (requested != (uint)requestedInterval_.loadAcquire())
+        return;
+
+    SysfsAdaptor::setInterval(value, pollSessionId_);
+}
+
+void IioAdaptor::commitFrame(const IioFrame &frame)
+{
+    if (!sink_)
+        return;
+
+    IioTrace::record(IioTrace::Commit, dev_accl_, 0, frame.count);
+    sink_->commit(frame);
+}
+
+void IioAdaptor::wakeUpReaders()
+{
+    if (!sink_)
+        return;
+
+    sink_->wakeUpReaders();
+    IioTrace::record(IioTrace::WakeUp, dev_accl_, 0);
+}
+
+void IioAdaptor::restartReader(int error, bool hadData)
+{
+#ifdef HAVE_LIBIIO
+    AdaptedSensorEntry *entry = getAdaptedSensor();
+    if (!iioReader_ || entry == NULL || !entry->isRunning())
+        return;
+
+    if (hadData)
+        readerRestarts_ = 0;
+
+    iioReader_->stopReading();
+    if (++readerRestarts_ > IIO_READER_MAX_RESTARTS) {
+        sensordLogW() << "Giving up on the iio buffer of" << descriptor_->sensorName
+                      << ":" << strerror(error);
+        return;
     }
+
+    sensordLogW() << "Restarting the iio buffer of" << descriptor_->sensorName;
+    if (!iioReader_->startReading())
+        sensordLogW() << "Failed to restart the iio buffer of" << descriptor_->sensorName;
+#else
+    Q_UNUSED(error);
+    Q_UNUSED(hadData);
+#endif
 }
 
 bool IioAdaptor::setInterval(const unsigned int value, const int sessionId)
 {
-    if (mode() == SysfsAdaptor::IntervalMode)
+    if (mode() == SysfsAdaptor::IntervalMode) {
+        pollSessionId_ = sessionId;
+        requestedInterval_.storeRelease(value);
         return SysfsAdaptor::setInterval(value, sessionId);
+    }
 
     sensordLogD() << "Ignoring setInterval for " << value;
 
@@ -601,15 +933,60 @@ bool IioAdaptor::setInterval(const unsigned int value, const int sessionId)
 bool IioAdaptor::startSensor()
 {
     qWarning() << Q_FUNC_INFO;
-    deviceEnable(dev_accl_, true);
+#ifdef HAVE_LIBIIO
+    if (iioReader_) {
+        AdaptedSensorEntry *entry = getAdaptedSensor();
+        if (entry == NULL)
+            return false;
+        entry->addReference();
+        if (entry->isRunning())
+            return false;
+        readerRestarts_ = 0;
+        if (!iioReader_->startReading()) {
+            entry->removeReference();
+            return false;
+        }
+        entry->setIsRunning(true);
+        return true;
+    }
+#endif
+    AdaptedSensorEntry *entry = getAdaptedSensor();
+    if (entry && !entry->isRunning()) {
+        // Disable and then enable the device to make sure it allows
+        // changing settings
+        deviceEnable(dev_accl_, false);
+        deviceEnable(dev_accl_, true);
+    }
     return SysfsAdaptor::startSensor();
 }
 
 void IioAdaptor::stopSensor()
 {
     qWarning() << Q_FUNC_INFO;
-    deviceEnable(dev_accl_, false);
+#ifdef HAVE_LIBIIO
+    if (iioReader_) {
+        AdaptedSensorEntry *entry = getAdaptedSensor();
+        if (entry == NULL || !entry->isRunning())
+            return;
+        entry->removeReference();
+        if (entry->referenceCount() <= 0) {
+            iioReader_->stopReading();
+            entry->setIsRunning(false);
+            if (sink_)
+                sink_->saveState(statePath());
+        }
+        return;
+    }
+#endif
     SysfsAdaptor::stopSensor();
+
+    // Channels stay on while any session is active
+    AdaptedSensorEntry *entry = getAdaptedSensor();
+    if (entry && !entry->isRunning()) {
+        deviceEnable(dev_accl_, false);
+        if (sink_)
+            sink_->saveState(statePath());
+    }
 }
 
 
@@ -29,6 +29,9 @@
 
 #include <sysfsadaptor.h>
 #include <datatypes/orientationdata.h>
+#include <QAtomicInt>
+
+#include "iiolayoutcache.h"
 
 #define IIO_SYSFS_BASE              "/sys/bus/iio/devices/"
 
@@ -47,7 +50,28 @@
 // FIXME: no idea what would be reasonable length
 #define IIO_BUFFER_LEN              256
 
-struct iio_device {
+// Consecutive libiio buffer restarts without data before giving up
+#define IIO_READER_MAX_RESTARTS     3
+
+// Adaptive polling: flat frames before backing off, and the weight of
+// a new sample in the running mean and variance
+#define IIO_ADAPTIVE_QUIET_FRAMES   8
+#define IIO_ADAPTIVE_ALPHA          0.125
+
+struct udev_device;
+class IioContextReader;
+class IioFrameSink;
+
+/**
+ * Raw channel values of one scan, ordered x, y, z.
+ */
+struct IioFrame {
+    int values[IIO_MAX_DEVICE_CHANNELS];
+    int count;
+    quint64 timestamp;
+};
+
+struct iio_device_info {
   QString name;
   int channels;
   int channel_bytes[IIO_MAX_DEVICE_CHANNELS];
@@ -62,10 +86,17 @@ struct iio_device {
  * Driver interface is located in @e /sys/bus/iio/devices/iio:deviceX/ .
  * <ul><li>@e angular_rate filehandle provides measurement values.</li></ul>
  * No other filehandles are currently in use by this adaptor.
+ *
+ * When built with libiio (@e CONFIG+=libiio) and @e iio/backend is set
+ * to @e libiio, samples are instead drained from an iio_buffer by
+ * #IioContextReader. @e iio/context_uri selects the context, so a
+ * remote iiod (@e ip:host) can stand in for local hardware.
  */
 class IioAdaptor : public SysfsAdaptor
 {
     Q_OBJECT
+    friend class IioContextReader;
+
     enum IioSensorType {
         IIO_ACCELEROMETER = 1, // accel_3d
         IIO_GYROSCOPE, // gyro_3d
@@ -75,6 +106,24 @@ class IioAdaptor : public SysfsAdaptor
         IIO_TILT // incli_3d
     };
 
+    /**
+     * Static description of a supported sensor type. Adding a sensor
+     * type means adding an entry to #sensorDescriptors_ and, for a new
+     * sample type, an #IioFrameTraits specialization.
+     */
+    struct SensorDescriptor {
+        const char *idPrefix;            // adaptor id prefix, e.g. "accel"
+        IioSensorType type;
+        const char *iioName;             // IIO device name, e.g. "accel_3d"
+        const char *channelPrefixes[2];  // sysfs channel prefixes, may be 0
+        const char *sensorName;          // adapted sensor name
+        const char *description;
+        IioFrameSink *(*createSink)(unsigned int size);
+        int channels;                    // frame values the sink consumes
+    };
+    static const SensorDescriptor sensorDescriptors_[];
+    static const int sensorDescriptorCount_;
+
 public:
     /**
      * Factory method for gaining a new instance of this adaptor class.
@@ -114,7 +163,8 @@ private:
 
     /**
      * Read and process data. Run when sysfsadaptor has detected new
-     * available data.
+     * available data. One call reads all polled channels of the
+     * device and commits one frame.
      *
      * @param pathId PathId for the file that had event.
      * @param fd Open file descriptor with new data. See
@@ -122,8 +172,59 @@ private:
      */
     void processSample(int pathId, int fd);
 
+    /**
+     * Publish one complete frame through the sink of the sensor type.
+     *
+     * @param frame Raw channel values in scan index order.
+     */
+    void commitFrame(const IioFrame &frame);
+
+    /**
+     * Let the readers of the ring buffer see the committed frames.
+     */
+    void wakeUpReaders();
+
+    /**
+     * Activity-adaptive poll rate for IntervalMode, see
+     * @e iio/adaptive_polling.
+     */
+    void adaptPollInterval(const IioFrame &frame);
+
+    /**
+     * Hand mount matrix, scale and offset to the sink.
+     */
+    void setupConversion();
+
+    /**
+     * True for the three-axis types a mount matrix applies to.
+     */
+    bool hasMountMatrix() const;
+
+    /**
+     * File the sink keeps persistent state in, e.g. magnetometer
+     * calibration. Directory set with @e iio/state_dir.
+     */
+    QString statePath() const;
+
     int sensorExists(IioAdaptor::IioSensorType sensor);
     int findSensor(const QString &name);
+
+    /**
+     * Device identity the layout cache is keyed on: sensor, IIO name,
+     * kernel release, parent modalias and parent syspath.
+     */
+    static QString deviceIdentity(struct udev_device *dev, const char *sensor);
+    QString layoutCachePath() const;
+
+    /**
+     * Take scale, offset, frequency and polled channels from #layout_
+     * instead of probing sysfs.
+     *
+     * @return false if the raw channels could not all be opened.
+     */
+    bool applyLayout();
+    void closeRawChannels();
+    bool probeScanElements();
 	bool deviceEnable(int device, int enable);
 
     QString deviceGetName(int device);
@@ -131,16 +232,22 @@ private:
 	QString sysfsReadString(QString filename);
 	int sysfsReadInt(QString filename);
 	int scanElementsEnable(int device, int enable);
+
+    /**
+     * Whether a channel is consumed by the current sensor type.
+     *
+     * @param channel Sysfs channel attribute, e.g. @e in_accel_x_en.
+     */
+    bool channelWanted(const QString &channel) const;
 	int deviceChannelParseBytes(QString filename);
 
 	// Device number for the sensor (-1 if not found)
     int dev_accl_;
 
-    DeviceAdaptorRingBuffer<TimedXyzData>* iioXyzBuffer_;
-    DeviceAdaptorRingBuffer<TimedUnsigned>* alsBuffer_;
-    DeviceAdaptorRingBuffer<CalibratedMagneticFieldData>* magnetometerBuffer_;
+    const SensorDescriptor *descriptor_;
+    IioFrameSink *sink_;
 
-	struct iio_device devices_[IIO_MAX_DEVICES];
+	struct iio_device_info devices_[IIO_MAX_DEVICES];
     QString deviceId;
     IioSensorType sensorType;
     QString devicePath;
@@ -148,13 +255,53 @@ private:
     int frequency;
     int offset;
     int numChannels;
-
-    TimedXyzData* timedData;
-    CalibratedMagneticFieldData *calData;
-    TimedUnsigned *uData;
+    // Number of polled *_raw channels
+    int rawChannels_;
+    // Persistent fds of polled channels 1..n-1, channel 0 is polled by
+    // SysfsAdaptor
+    int rawFds_[IIO_MAX_DEVICE_CHANNELS];
+
+    // Frame being assembled by processSample()
+    IioFrame frame_;
+
+    // What probing found, or what the layout cache returned
+    IioDeviceLayout layout_;
+    bool layoutCached_;
+
+    // Adaptive polling configuration
+    bool adaptivePolling_;
+    double adaptiveThreshold_;
+    double adaptiveStep_;
+    unsigned int adaptiveMaxInterval_;
+    // Set from the main thread, read by the reader thread
+    QAtomicInt requestedInterval_;
+    // Main thread only
+    int pollSessionId_;
+    // Reader thread only
+    unsigned int pollBase_;
+    unsigned int pollInterval_;
+    int quietFrames_;
+    bool pollStatsValid_;
+    double pollMean_[IIO_MAX_DEVICE_CHANNELS];
+    double pollVariance_[IIO_MAX_DEVICE_CHANNELS];
+
+    IioContextReader *iioReader_;
+    int readerRestarts_;
 
 private slots:
     void setup();
+
+    /**
+     * Apply an interval chosen by adaptPollInterval() on the main
+     * thread, unless @e requested is no longer the client's interval.
+     */
+    void applyPollInterval(uint value, uint requested);
+
+    /**
+     * Recreate the libiio buffer after the reader thread stopped on a
+     * failed refill, while sessions still want samples.
+     */
+    void restartReader(int error, bool hadData);
 };
 
 #endif
@@ -11,17 +11,29 @@ CONFIG += link_pkgconfig
 PKGCONFIG += udev
 LIBS += -ludev
 
-#PKGCONFIG += libiio
-#LIBS += -liio
+# Optional libiio backend, build with: qmake CONFIG+=libiio
+libiio {
+    PKGCONFIG += libiio
+    DEFINES += HAVE_LIBIIO
+    HEADERS += iiocontextreader.h
+    SOURCES += iiocontextreader.cpp
+}
 
 TEMPLATE = lib
 
 TARGET       = iioaccelerometeradaptor-qt5
 
 HEADERS += iioadaptor.h \
+           iiosamplesink.h \
+           iiomagcalibrator.h \
+           iiotrace.h \
+           iiolayoutcache.h \
            iioadaptorplugin.h
 
 SOURCES += iioadaptor.cpp \
+           iiomagcalibrator.cpp \
+           iiotrace.cpp \
+           iiolayoutcache.cpp \
            iioadaptorplugin.cpp
 
 target.path = /usr/lib/sensord-qt5
@@ -0,0 +1,276 @@
+/**
+   @file iiocontextreader.cpp
+   @brief libiio based reader for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+
+#include <iio.h>
+
+#include <logging.h>
+#include <datatypes/utils.h>
+
+#include "iiocontextreader.h"
+#include "iioadaptor.h"
+#include "iiotrace.h"
+
+// Converted sample of one channel, sign extended to 64 bits
+static qint64 channelValue(const struct iio_channel *chn, const void *src)
+{
+    const struct iio_data_format *format = iio_channel_get_data_format(chn);
+    union {
+        qint8 s8; quint8 u8;
+        qint16 s16; quint16 u16;
+        qint32 s32; quint32 u32;
+        qint64 s64;
+    } value;
+    value.s64 = 0;
+
+    iio_channel_convert(chn, &value, src);
+
+    switch (format->length) {
+    case 8:
+        return format->is_signed ? value.s8 : value.u8;
+    case 16:
+        return format->is_signed ? value.s16 : value.u16;
+    case 32:
+        return format->is_signed ? value.s32 : value.u32;
+    default:
+        return value.s64;
+    }
+}
+
+static bool channelLessThan(const struct iio_channel *a, const struct iio_channel *b)
+{
+    return iio_channel_get_index(a) < iio_channel_get_index(b);
+}
+
+IioContextReader::IioContextReader(IioAdaptor *parent) :
+    parent_(parent),
+    context_(0),
+    device_(0),
+    buffer_(0),
+    timestampChannel_(0),
+    bufferSamples_(IIO_BUFFER_LEN),
+    running_(0)
+{
+}
+
+IioContextReader::~IioContextReader()
+{
+    stopReading();
+    close();
+}
+
+bool IioContextReader::open(const QString &uri, const QString &deviceName)
+{
+    close();
+
+    if (uri.isEmpty())
+        context_ = iio_create_default_context();
+    else
+        context_ = iio_create_context_from_uri(uri.toLatin1().constData());
+
+    if (!context_) {
+        sensordLogW() << "Failed to create iio context" << uri << ":" << strerror(errno);
+        return false;
+    }
+
+    device_ = iio_context_find_device(context_, deviceName.toLatin1().constData());
+    if (!device_) {
+        sensordLogD() << "No iio device" << deviceName << "in context" << uri;
+        close();
+        return false;
+    }
+
+    unsigned int count = iio_device_get_channels_count(device_);
+    for (unsigned int i = 0; i < count; ++i) {
+        struct iio_channel *chn = iio_device_get_channel(device_, i);
+        if (iio_channel_is_output(chn) || !iio_channel_is_scan_element(chn))
+            continue;
+
+        QString id = QString::fromLatin1(iio_channel_get_id(chn));
+        if (id == QLatin1String("timestamp"))
+            timestampChannel_ = chn;
+        else if (parent_->channelWanted(QLatin1String("in_") + id))
+            channels_.append(chn);
+    }
+    std::sort(channels_.begin(), channels_.end(), channelLessThan);
+
+    return true;
+}
+
+void IioContextReader::close()
+{
+    channels_.clear();
+    timestampChannel_ = 0;
+    device_ = 0;
+    if (context_) {
+        iio_context_destroy(context_);
+        context_ = 0;
+    }
+}
+
+void IioContextReader::setBufferSamples(unsigned int samples)
+{
+    if (samples > 0)
+        bufferSamples_ = samples;
+}
+
+double IioContextReader::channelScale() const
+{
+    for (int i = 0; i < channels_.size(); ++i) {
+        double value;
+        if (iio_channel_attr_read_double(channels_.at(i), "scale", &value) == 0)
+            return value;
+    }
+    return -1;
+}
+
+double IioContextReader::channelOffset() const
+{
+    for (int i = 0; i < channels_.size(); ++i) {
+        double value;
+        if (iio_channel_attr_read_double(channels_.at(i), "offset", &value) == 0)
+            return value;
+    }
+    return 0;
+}
+
+QString IioContextReader::channelAttribute(const char *attr) const
+{
+    char buf[256];
+    for (int i = 0; i < channels_.size(); ++i) {
+        if (iio_channel_attr_read(channels_.at(i), attr, buf, sizeof(buf)) > 0)
+            return QString::fromLatin1(buf).trimmed();
+    }
+    return QString();
+}
+
+bool IioContextReader::enableChannels()
+{
+    if (channels_.isEmpty())
+        return false;
+
+    for (int i = 0; i < channels_.size(); ++i)
+        iio_channel_enable(channels_.at(i));
+    if (timestampChannel_)
+        iio_channel_enable(timestampChannel_);
+
+    return true;
+}
+
+void IioContextReader::disableChannels()
+{
+    for (int i = 0; i < channels_.size(); ++i)
+        iio_channel_disable(channels_.at(i));
+    if (timestampChannel_)
+        iio_channel_disable(timestampChannel_);
+}
+
+bool IioContextReader::startReading()
+{
+    if (running_.loadAcquire())
+        return true;
+    if (!device_ || !enableChannels())
+        return false;
+
+    buffer_ = iio_device_create_buffer(device_, bufferSamples_, false);
+    if (!buffer_) {
+        sensordLogW() << "Failed to create iio buffer:" << strerror(errno);
+        disableChannels();
+        return false;
+    }
+
+    running_.storeRelease(1);
+    start();
+    return true;
+}
+
+void IioContextReader::stopReading()
+{
+    if (!running_.loadAcquire())
+        return;
+
+    running_.storeRelease(0);
+    iio_buffer_cancel(buffer_);
+    wait();
+
+    iio_buffer_destroy(buffer_);
+    buffer_ = 0;
+    disableChannels();
+}
+
+void IioContextReader::run()
+{
+    IioFrame frame;
+    frame.count = qMin(channels_.size(), IIO_MAX_DEVICE_CHANNELS);
+    bool hadData = false;
+
+    while (running_.loadAcquire()) {
+        ssize_t ret = iio_buffer_refill(buffer_);
+        if (ret < 0) {
+            // Not an error when stopReading() cancelled the buffer
+            if (running_.loadAcquire()) {
+                IioTrace::record(IioTrace::Error, parent_->dev_accl_, 0, -ret);
+                sensordLogW() << "iio_buffer_refill():" << strerror(-ret);
+                emit readFailed(-ret, hadData);
+            }
+            break;
+        }
+        IioTrace::record(IioTrace::Refill, parent_->dev_accl_, 0, ret);
+        hadData = true;
+
+        const ptrdiff_t step = iio_buffer_step(buffer_);
+        const char *end = static_cast<const char *>(iio_buffer_end(buffer_));
+        quint64 now = Utils::getTimeStamp();
+
+        // Kernel timestamps are in ns on their own clock, so only use
+        // them for the spacing of samples relative to the newest one.
+        qint64 lastTimestamp = 0;
+        if (timestampChannel_) {
+            const char *first = static_cast<const char *>(iio_buffer_first(buffer_, timestampChannel_));
+            lastTimestamp = channelValue(timestampChannel_, first + ((end - first) / step - 1) * step);
+        }
+
+        for (ptrdiff_t offset = 0; ; offset += step) {
+            const char *first = static_cast<const char *>(iio_buffer_first(buffer_, channels_.at(0))) + offset;
+            if (first >= end)
+                break;
+
+            for (int i = 0; i < frame.count; ++i) {
+                const char *src = static_cast<const char *>(iio_buffer_first(buffer_, channels_.at(i))) + offset;
+                frame.values[i] = channelValue(channels_.at(i), src);
+            }
+
+            frame.timestamp = now;
+            if (timestampChannel_) {
+                const char *src = static_cast<const char *>(iio_buffer_first(buffer_, timestampChannel_)) + offset;
+                frame.timestamp = now - (lastTimestamp - channelValue(timestampChannel_, src)) / 1000;
+            }
+
+            IioTrace::record(IioTrace::Decode, parent_->dev_accl_, 0, frame.count);
+            parent_->commitFrame(frame);
+        }
+        parent_->wakeUpReaders();
+    }
+}
@@ -0,0 +1,117 @@
+/**
+   @file iiocontextreader.h
+   @brief libiio based reader for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+
+#ifndef IIOCONTEXTREADER_H
+#define IIOCONTEXTREADER_H
+
+#include <QThread>
+#include <QString>
+#include <QVector>
+#include <QAtomicInt>
+
+struct iio_context;
+struct iio_device;
+struct iio_channel;
+struct iio_buffer;
+
+class IioAdaptor;
+
+/**
+ * @brief Reader thread for the libiio backend of IioAdaptor.
+ *
+ * Opens an iio_context (local, or any libiio URI such as @e ip:host
+ * for a remote iiod), enables the scan elements of the named device
+ * and drains samples with iio_buffer_refill(). All frames of a refill
+ * are committed to the ring buffer before readers are woken once, so
+ * the block size set with #setBufferSamples() directly controls the
+ * wakeup batching.
+ */
+class IioContextReader : public QThread
+{
+    Q_OBJECT
+public:
+    IioContextReader(IioAdaptor *parent);
+    ~IioContextReader();
+
+    /**
+     * Create the context and look up the device.
+     *
+     * @param uri libiio context URI. Empty string means the default
+     *            context (local, or IIOD_REMOTE when set).
+     * @param deviceName IIO device name, e.g. @e accel_3d.
+     * @return true if the device exists in the context.
+     */
+    bool open(const QString &uri, const QString &deviceName);
+
+    /**
+     * Number of frames requested per iio_buffer_refill().
+     */
+    void setBufferSamples(unsigned int samples);
+    unsigned int bufferSamples() const { return bufferSamples_; }
+
+    bool startReading();
+    void stopReading();
+
+    /**
+     * Value of the first channel @e scale attribute found, or -1.
+     */
+    double channelScale() const;
+
+    /**
+     * Value of the first channel @e offset attribute found, or 0.
+     */
+    double channelOffset() const;
+
+    /**
+     * Value of the first channel attribute @e attr found, or empty.
+     */
+    QString channelAttribute(const char *attr) const;
+
+signals:
+    /**
+     * iio_buffer_refill() failed and the reader thread stopped.
+     *
+     * @param error errno of the failure.
+     * @param hadData true if earlier refills of this run succeeded.
+     */
+    void readFailed(int error, bool hadData);
+
+protected:
+    void run();
+
+private:
+    void close();
+    bool enableChannels();
+    void disableChannels();
+
+    IioAdaptor *parent_;
+    struct iio_context *context_;
+    struct iio_device *device_;
+    struct iio_buffer *buffer_;
+    QVector<struct iio_channel *> channels_;
+    struct iio_channel *timestampChannel_;
+    unsigned int bufferSamples_;
+    QAtomicInt running_;
+};
+
+#endif
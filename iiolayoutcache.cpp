@@ -0,0 +1,156 @@
+/**
+   @file iiolayoutcache.cpp
+   @brief Persistent cache of probed IIO device layouts
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+#include <QSettings>
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QCryptographicHash>
+
+#include <logging.h>
+
+#include "iiolayoutcache.h"
+
+// Bump whenever the meaning of a cached field changes
+#define IIO_LAYOUT_CACHE_VERSION    3
+
+IioLayoutCache::IioLayoutCache(const QString &path) :
+    path_(path)
+{
+}
+
+QString IioLayoutCache::group(const QString &identity)
+{
+    return QString::fromLatin1(QCryptographicHash::hash(identity.toUtf8(),
+                                                        QCryptographicHash::Sha1).toHex());
+}
+
+bool IioLayoutCache::readAttribute(const QString &path, double *value)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    bool ok;
+    *value = QString::fromLatin1(file.readAll()).trimmed().toDouble(&ok);
+    return ok;
+}
+
+bool IioLayoutCache::load(const QString &identity, const QString &devicePath, IioDeviceLayout *layout) const
+{
+    if (path_.isEmpty() || !QFileInfo(path_).exists())
+        return false;
+
+    QSettings settings(path_, QSettings::IniFormat);
+    if (settings.value("version").toInt() != IIO_LAYOUT_CACHE_VERSION)
+        return false;
+
+    settings.beginGroup(group(identity));
+    if (settings.value("identity").toString() != identity)
+        return false;
+
+    QStringList rawChannels = settings.value("raw").toStringList();
+    if (rawChannels.isEmpty())
+        return false;
+
+    // Cheap sanity check: stat, no reads
+    for (int i = 0; i < rawChannels.size(); ++i) {
+        if (!QFileInfo(devicePath + rawChannels.at(i)).exists()) {
+            sensordLogD() << "Cached layout for" << identity << "is stale";
+            return false;
+        }
+    }
+
+    QList<iio_scan_element> scanElements;
+    QStringList elements = settings.value("scan_elements").toStringList();
+    for (int i = 0; i < elements.size(); ++i) {
+        QStringList fields = elements.at(i).split(':');
+        if (fields.size() != 3)
+            return false;
+        iio_scan_element element;
+        element.name = fields.at(0);
+        element.index = fields.at(1).toInt();
+        element.bytes = fields.at(2).toInt();
+        scanElements << element;
+    }
+
+    // Scale and offset are often writable (range selection, udev
+    // rules), so take their current values rather than the cached ones
+    QString scaleAttribute = settings.value("scale_attribute").toString();
+    QString offsetAttribute = settings.value("offset_attribute").toString();
+    double scale = -1;
+    double offset = 0;
+    if ((!scaleAttribute.isEmpty() && !readAttribute(devicePath + scaleAttribute, &scale))
+            || (!offsetAttribute.isEmpty() && !readAttribute(devicePath + offsetAttribute, &offset))) {
+        sensordLogD() << "Cached layout for" << identity << "is stale";
+        return false;
+    }
+
+    layout->identity = identity;
+    layout->rawChannels = rawChannels;
+    layout->scanElements = scanElements;
+    layout->mountMatrix = settings.value("mount_matrix").toString();
+    layout->scale = scale;
+    layout->offset = offset;
+    layout->frequency = settings.value("frequency", 0).toInt();
+    layout->scaleAttribute = scaleAttribute;
+    layout->offsetAttribute = offsetAttribute;
+
+    return true;
+}
+
+bool IioLayoutCache::store(const IioDeviceLayout &layout)
+{
+    if (path_.isEmpty())
+        return false;
+
+    QDir().mkpath(QFileInfo(path_).absolutePath());
+
+    QStringList elements;
+    for (int i = 0; i < layout.scanElements.size(); ++i) {
+        const iio_scan_element &element = layout.scanElements.at(i);
+        elements << QString("%1:%2:%3").arg(element.name).arg(element.index).arg(element.bytes);
+    }
+
+    QSettings settings(path_, QSettings::IniFormat);
+    if (settings.value("version").toInt() != IIO_LAYOUT_CACHE_VERSION) {
+        settings.clear();
+        settings.setValue("version", IIO_LAYOUT_CACHE_VERSION);
+    }
+
+    settings.beginGroup(group(layout.identity));
+    settings.setValue("identity", layout.identity);
+    settings.setValue("raw", layout.rawChannels);
+    settings.setValue("scan_elements", elements);
+    settings.setValue("mount_matrix", layout.mountMatrix);
+    settings.setValue("scale_attribute", layout.scaleAttribute);
+    settings.setValue("offset_attribute", layout.offsetAttribute);
+    settings.setValue("frequency", layout.frequency);
+    settings.endGroup();
+    settings.sync();
+
+    if (settings.status() != QSettings::NoError) {
+        sensordLogW() << "Failed to write iio layout cache" << path_;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,84 @@
+/**
+   @file iiolayoutcache.h
+   @brief Persistent cache of probed IIO device layouts
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+
+#ifndef IIOLAYOUTCACHE_H
+#define IIOLAYOUTCACHE_H
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+
+struct iio_scan_element {
+    QString name;   // sysfs base name, e.g. in_accel_x
+    int index;      // scan index, -1 when not used by the sensor
+    int bytes;      // storage bytes, 0 when not used by the sensor
+};
+
+/**
+ * Everything the adaptor learns about a device by probing sysfs.
+ * Channel names are relative to the device directory, so a layout
+ * stays valid when the iio:deviceX numbering changes between boots.
+ */
+struct IioDeviceLayout {
+    QString identity;
+    QStringList rawChannels;
+    QList<iio_scan_element> scanElements;
+    QString mountMatrix;
+    double scale;
+    int offset;
+    int frequency;
+    // Attributes scale and offset were read from, empty if none. Both
+    // can be changed at runtime, so they are re-read on a cache hit.
+    QString scaleAttribute;
+    QString offsetAttribute;
+};
+
+/**
+ * @brief Versioned on-disk cache of #IioDeviceLayout.
+ *
+ * Layouts are stored in one ini file, keyed by a device identity
+ * string built from the sensor, the IIO name, the modalias and the
+ * parent syspath. A stale or foreign entry is simply not returned and
+ * the caller does a full probe.
+ */
+class IioLayoutCache
+{
+public:
+    IioLayoutCache(const QString &path);
+
+    /**
+     * Look up the layout for @e identity. Checks the cache version and
+     * that the cached raw channels still exist under @e devicePath, and
+     * reads the current scale and offset from the device.
+     */
+    bool load(const QString &identity, const QString &devicePath, IioDeviceLayout *layout) const;
+    bool store(const IioDeviceLayout &layout);
+
+private:
+    static QString group(const QString &identity);
+    static bool readAttribute(const QString &path, double *value);
+
+    QString path_;
+};
+
+#endif
@@ -0,0 +1,309 @@
+/**
+   @file iiomagcalibrator.cpp
+   @brief Streaming magnetometer calibration for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+#include <math.h>
+
+#include <QSettings>
+#include <QVariantList>
+#include <QFileInfo>
+#include <QDir>
+#include <QtAlgorithms>
+
+#include <logging.h>
+#include <datatypes/orientationdata.h>
+
+#include "iiomagcalibrator.h"
+
+#define IIO_MAGCAL_VERSION       1
+
+// Re-solve the fit every this many samples
+#define IIO_MAGCAL_SOLVE_EVERY   16
+
+// Samples needed before the first solution is trusted
+#define IIO_MAGCAL_MIN_SAMPLES   64
+
+// Reject fits whose semi axes differ more than this
+#define IIO_MAGCAL_MAX_AXIS_RATIO 2.0
+
+IioMagCalibrator::IioMagCalibrator()
+{
+    setWindow(1024);
+    reset();
+}
+
+void IioMagCalibrator::setWindow(int samples)
+{
+    if (samples < IIO_MAGCAL_MIN_SAMPLES)
+        samples = IIO_MAGCAL_MIN_SAMPLES;
+    lambda_ = 1.0 - 1.0 / samples;
+}
+
+void IioMagCalibrator::reset()
+{
+    for (int i = 0; i < Params; ++i) {
+        for (int j = 0; j < Params; ++j)
+            normal_[i][j] = 0;
+        rhs_[i] = 0;
+    }
+    samples_ = 0;
+    pending_ = 0;
+    unit_ = 0;
+    valid_ = false;
+    for (int i = 0; i < 3; ++i) {
+        center_[i] = 0;
+        gain_[i] = 1;
+    }
+    radius_ = 1;
+    residual_ = 1;
+    octants_ = 0;
+    level_ = 0;
+}
+
+void IioMagCalibrator::process(CalibratedMagneticFieldData *data)
+{
+    double x = data->rx_;
+    double y = data->ry_;
+    double z = data->rz_;
+
+    if (unit_ <= 0) {
+        unit_ = sqrt(x * x + y * y + z * z);
+        if (unit_ <= 0) {
+            data->x_ = data->rx_;
+            data->y_ = data->ry_;
+            data->z_ = data->rz_;
+            data->level_ = 0;
+            return;
+        }
+    }
+
+    x /= unit_;
+    y /= unit_;
+    z /= unit_;
+
+    accumulate(x, y, z);
+    if (++pending_ >= IIO_MAGCAL_SOLVE_EVERY) {
+        pending_ = 0;
+        solve();
+    }
+
+    if (!valid_) {
+        data->x_ = data->rx_;
+        data->y_ = data->ry_;
+        data->z_ = data->rz_;
+        data->level_ = 0;
+        return;
+    }
+
+    double cx = (x - center_[0]) * gain_[0];
+    double cy = (y - center_[1]) * gain_[1];
+    double cz = (z - center_[2]) * gain_[2];
+    updateLevel(cx, cy, cz);
+
+    data->x_ = cx * unit_;
+    data->y_ = cy * unit_;
+    data->z_ = cz * unit_;
+    data->level_ = level_;
+}
+
+void IioMagCalibrator::accumulate(double x, double y, double z)
+{
+    const double phi[Params] = { x * x, y * y, z * z, x, y, z };
+
+    for (int i = 0; i < Params; ++i) {
+        for (int j = i; j < Params; ++j)
+            normal_[i][j] = lambda_ * normal_[i][j] + phi[i] * phi[j];
+        rhs_[i] = lambda_ * rhs_[i] + phi[i];
+    }
+    if (samples_ < IIO_MAGCAL_MIN_SAMPLES)
+        samples_++;
+}
+
+bool IioMagCalibrator::solve()
+{
+    if (samples_ < IIO_MAGCAL_MIN_SAMPLES)
+        return false;
+
+    // Gaussian elimination with partial pivoting on a copy
+    double m[Params][Params + 1];
+    for (int i = 0; i < Params; ++i) {
+        for (int j = 0; j < Params; ++j)
+            m[i][j] = j >= i ? normal_[i][j] : normal_[j][i];
+        m[i][Params] = rhs_[i];
+    }
+
+    for (int col = 0; col < Params; ++col) {
+        int pivot = col;
+        for (int row = col + 1; row < Params; ++row) {
+            if (fabs(m[row][col]) > fabs(m[pivot][col]))
+                pivot = row;
+        }
+        if (fabs(m[pivot][col]) < 1e-12)
+            return false;
+        if (pivot != col) {
+            for (int j = col; j <= Params; ++j)
+                qSwap(m[col][j], m[pivot][j]);
+        }
+        for (int row = col + 1; row < Params; ++row) {
+            double f = m[row][col] / m[col][col];
+            for (int j = col; j <= Params; ++j)
+                m[row][j] -= f * m[col][j];
+        }
+    }
+
+    double p[Params];
+    for (int i = Params - 1; i >= 0; --i) {
+        double sum = m[i][Params];
+        for (int j = i + 1; j < Params; ++j)
+            sum -= m[i][j] * p[j];
+        p[i] = sum / m[i][i];
+    }
+
+    if (p[0] <= 0 || p[1] <= 0 || p[2] <= 0)
+        return false;
+
+    double center[3];
+    double g = 1;
+    for (int i = 0; i < 3; ++i) {
+        center[i] = -p[i + 3] / (2 * p[i]);
+        g += p[i] * center[i] * center[i];
+    }
+    if (g <= 0)
+        return false;
+
+    double axis[3];
+    double minAxis = 0;
+    double maxAxis = 0;
+    for (int i = 0; i < 3; ++i) {
+        axis[i] = sqrt(g / p[i]);
+        if (i == 0 || axis[i] < minAxis)
+            minAxis = axis[i];
+        if (i == 0 || axis[i] > maxAxis)
+            maxAxis = axis[i];
+    }
+    if (maxAxis > IIO_MAGCAL_MAX_AXIS_RATIO * minAxis)
+        return false;
+
+    // Keep the field strength, only make it round
+    radius_ = cbrt(axis[0] * axis[1] * axis[2]);
+    for (int i = 0; i < 3; ++i) {
+        center_[i] = center[i];
+        gain_[i] = radius_ / axis[i];
+    }
+    valid_ = true;
+
+    return true;
+}
+
+void IioMagCalibrator::updateLevel(double x, double y, double z)
+{
+    double error = fabs(sqrt(x * x + y * y + z * z) / radius_ - 1);
+    residual_ = 0.95 * residual_ + 0.05 * error;
+    octants_ |= 1 << ((x > 0) | (y > 0) << 1 | (z > 0) << 2);
+
+    int seen = qPopulationCount(octants_);
+    if (residual_ < 0.05 && seen == 8)
+        level_ = 3;
+    else if (residual_ < 0.1 && seen >= 6)
+        level_ = 2;
+    else
+        level_ = 1;
+}
+
+bool IioMagCalibrator::load(const QString &path)
+{
+    if (!QFileInfo(path).exists())
+        return false;
+
+    QSettings settings(path, QSettings::IniFormat);
+    if (settings.value("version").toInt() != IIO_MAGCAL_VERSION) {
+        sensordLogW() << "Ignoring magnetometer calibration" << path << "with wrong version";
+        return false;
+    }
+
+    QVariantList normal = settings.value("normal").toList();
+    QVariantList rhs = settings.value("rhs").toList();
+    QVariantList center = settings.value("center").toList();
+    QVariantList gain = settings.value("gain").toList();
+    if (normal.size() != Params * Params || rhs.size() != Params
+            || center.size() != 3 || gain.size() != 3)
+        return false;
+
+    reset();
+    for (int i = 0; i < Params; ++i) {
+        for (int j = 0; j < Params; ++j)
+            normal_[i][j] = normal.at(i * Params + j).toDouble();
+        rhs_[i] = rhs.at(i).toDouble();
+    }
+    for (int i = 0; i < 3; ++i) {
+        center_[i] = center.at(i).toDouble();
+        gain_[i] = gain.at(i).toDouble();
+    }
+    unit_ = settings.value("unit").toDouble();
+    radius_ = settings.value("radius", 1).toDouble();
+    samples_ = settings.value("samples").toInt();
+    valid_ = settings.value("valid").toBool() && unit_ > 0;
+
+    // The fit is trusted, but coverage has to be seen again
+    level_ = valid_ ? 1 : 0;
+
+    return true;
+}
+
+bool IioMagCalibrator::save(const QString &path) const
+{
+    if (unit_ <= 0)
+        return false;
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    QVariantList normal;
+    QVariantList rhs;
+    QVariantList center;
+    QVariantList gain;
+    for (int i = 0; i < Params; ++i) {
+        for (int j = 0; j < Params; ++j)
+            normal << normal_[i][j];
+        rhs << rhs_[i];
+    }
+    for (int i = 0; i < 3; ++i) {
+        center << center_[i];
+        gain << gain_[i];
+    }
+
+    QSettings settings(path, QSettings::IniFormat);
+    settings.setValue("version", IIO_MAGCAL_VERSION);
+    settings.setValue("unit", unit_);
+    settings.setValue("radius", radius_);
+    settings.setValue("samples", samples_);
+    settings.setValue("valid", valid_);
+    settings.setValue("normal", normal);
+    settings.setValue("rhs", rhs);
+    settings.setValue("center", center);
+    settings.setValue("gain", gain);
+    settings.sync();
+
+    if (settings.status() != QSettings::NoError) {
+        sensordLogW() << "Failed to save magnetometer calibration to" << path;
+        return false;
+    }
+    return true;
+}
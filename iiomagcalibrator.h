@@ -0,0 +1,92 @@
+/**
+   @file iiomagcalibrator.h
+   @brief Streaming magnetometer calibration for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+
+#ifndef IIOMAGCALIBRATOR_H
+#define IIOMAGCALIBRATOR_H
+
+#include <QString>
+
+class CalibratedMagneticFieldData;
+
+/**
+ * @brief Incremental hard and soft iron calibration.
+ *
+ * Fits an axis aligned ellipsoid
+ * <pre>a x^2 + b y^2 + c z^2 + d x + e y + f z = 1</pre>
+ * by recursive least squares. Only the 6x6 normal equations are kept,
+ * aged with a forgetting factor, so memory is constant and the cost per
+ * sample is O(1). The ellipsoid centre gives the hard iron offset and
+ * the semi axes the per-axis soft iron gain.
+ */
+class IioMagCalibrator
+{
+public:
+    enum { Params = 6 };
+
+    IioMagCalibrator();
+
+    /**
+     * Number of samples the fit effectively remembers.
+     */
+    void setWindow(int samples);
+
+    /**
+     * Feed the raw values in @e rx_, @e ry_ and @e rz_ and fill in
+     * @e x_, @e y_, @e z_ and @e level_ with the current solution.
+     */
+    void process(CalibratedMagneticFieldData *data);
+
+    void reset();
+
+    bool load(const QString &path);
+    bool save(const QString &path) const;
+
+    int level() const { return level_; }
+
+private:
+    void accumulate(double x, double y, double z);
+    bool solve();
+    void updateLevel(double x, double y, double z);
+
+    double lambda_;
+    // Normal equations, upper triangle used
+    double normal_[Params][Params];
+    double rhs_[Params];
+    int samples_;
+    int pending_;
+
+    // Inputs are divided by this to keep the normal equations well
+    // conditioned; taken from the first sample after reset().
+    double unit_;
+
+    bool valid_;
+    double center_[3];
+    double gain_[3];
+    double radius_;
+
+    double residual_;
+    unsigned int octants_;
+    int level_;
+};
+
+#endif
@@ -0,0 +1,226 @@
+/**
+   @file iiosamplesink.h
+   @brief Per sensor type frame sinks for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+
+#ifndef IIOSAMPLESINK_H
+#define IIOSAMPLESINK_H
+
+#include <sensord-qt5/deviceadaptorringbuffer.h>
+#include <datatypes/orientationdata.h>
+
+#include "iioadaptor.h"
+#include "iiomagcalibrator.h"
+
+/**
+ * Per-frame conversion from raw counts to output units:
+ * out = M * (raw + offset) * scale * factor, with the mount matrix,
+ * scale and unit factor folded into one 3x3 matrix and a bias, so one
+ * multiply-add pass per axis does scaling and rotation.
+ */
+struct IioConversion
+{
+    double matrix[3][3];
+    double bias[3];
+
+    IioConversion()
+    {
+        static const double identity[3][3] = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 } };
+        set(identity, 1, 0, 1);
+    }
+
+    void set(const double mount[3][3], double scale, double offset, double factor)
+    {
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j)
+                matrix[i][j] = factor * mount[i][j] * scale;
+            bias[i] = (matrix[i][0] + matrix[i][1] + matrix[i][2]) * offset;
+        }
+    }
+
+    double axis(int i, const IioFrame &frame) const
+    {
+        return matrix[i][0] * frame.values[0]
+                + matrix[i][1] * frame.values[1]
+                + matrix[i][2] * frame.values[2]
+                + bias[i];
+    }
+
+    double scalar(const IioFrame &frame) const
+    {
+        return matrix[0][0] * frame.values[0] + bias[0];
+    }
+};
+
+/**
+ * How a frame of raw channel values is stored into a sample of type T.
+ * Specialize this for each ring buffer type; everything in here is
+ * resolved at compile time. Factor is the unit multiplier applied on
+ * top of the IIO scale; axis orientation comes from the mount matrix.
+ */
+template <typename T>
+struct IioFrameTraits;
+
+template <>
+struct IioFrameTraits<TimedXyzData>
+{
+    enum { Channels = 3, Factor = 100 };
+
+    static void fill(TimedXyzData *d, const IioFrame &frame, const IioConversion &conv)
+    {
+        d->x_ = conv.axis(0, frame);
+        d->y_ = conv.axis(1, frame);
+        d->z_ = conv.axis(2, frame);
+    }
+};
+
+template <>
+struct IioFrameTraits<CalibratedMagneticFieldData>
+{
+    enum { Channels = 3, Factor = 100 };
+
+    static void fill(CalibratedMagneticFieldData *d, const IioFrame &frame, const IioConversion &conv)
+    {
+        d->rx_ = d->x_ = conv.axis(0, frame);
+        d->ry_ = d->y_ = conv.axis(1, frame);
+        d->rz_ = d->z_ = conv.axis(2, frame);
+    }
+};
+
+template <>
+struct IioFrameTraits<TimedUnsigned>
+{
+    enum { Channels = 1, Factor = 1 };
+
+    static void fill(TimedUnsigned *d, const IioFrame &frame, const IioConversion &conv)
+    {
+        d->value_ = conv.scalar(frame);
+    }
+};
+
+/**
+ * Receives complete frames from the adaptor and publishes them.
+ */
+class IioFrameSink
+{
+public:
+    virtual ~IioFrameSink() {}
+
+    /**
+     * Fold mount matrix, IIO scale and offset into the conversion.
+     */
+    virtual void setConversion(const double mount[3][3], double scale, double offset) = 0;
+
+    /**
+     * Store @e frame in the ring buffer without waking readers, so a
+     * whole block of frames can be published with one wakeUpReaders().
+     */
+    virtual void commit(const IioFrame &frame) = 0;
+    virtual void wakeUpReaders() = 0;
+    virtual RingBufferBase *buffer() = 0;
+
+    /**
+     * Restore and persist state that should survive a restart.
+     */
+    virtual void loadState(const QString &/*path*/) {}
+    virtual void saveState(const QString &/*path*/) {}
+
+protected:
+    IioConversion conversion_;
+};
+
+/**
+ * Sink decoding each frame straight into a ring buffer slot. The ring
+ * holds @e size frames, enough for one block of the reader.
+ */
+template <typename T>
+class IioRingBufferSink : public IioFrameSink
+{
+public:
+    IioRingBufferSink(unsigned int size) : buffer_(size) {}
+
+    void setConversion(const double mount[3][3], double scale, double offset)
+    {
+        conversion_.set(mount, scale, offset, IioFrameTraits<T>::Factor);
+    }
+
+    void commit(const IioFrame &frame)
+    {
+        if (frame.count < IioFrameTraits<T>::Channels)
+            return;
+
+        T *slot = buffer_.nextSlot();
+        IioFrameTraits<T>::fill(slot, frame, conversion_);
+        slot->timestamp_ = frame.timestamp;
+        buffer_.commit();
+    }
+
+    void wakeUpReaders() { buffer_.wakeUpReaders(); }
+
+    RingBufferBase *buffer() { return &buffer_; }
+
+protected:
+    DeviceAdaptorRingBuffer<T> buffer_;
+};
+
+/**
+ * Magnetometer sink running the streaming calibration on every frame,
+ * so @e x_, @e y_, @e z_ and @e level_ are filled before readers see
+ * the sample.
+ */
+class IioMagnetometerSink : public IioRingBufferSink<CalibratedMagneticFieldData>
+{
+public:
+    IioMagnetometerSink(unsigned int size) :
+        IioRingBufferSink<CalibratedMagneticFieldData>(size) {}
+
+    void commit(const IioFrame &frame)
+    {
+        if (frame.count < IioFrameTraits<CalibratedMagneticFieldData>::Channels)
+            return;
+
+        CalibratedMagneticFieldData *slot = buffer_.nextSlot();
+        IioFrameTraits<CalibratedMagneticFieldData>::fill(slot, frame, conversion_);
+        calibrator_.process(slot);
+        slot->timestamp_ = frame.timestamp;
+        buffer_.commit();
+    }
+
+    void loadState(const QString &path) { calibrator_.load(path); }
+    void saveState(const QString &path) { calibrator_.save(path); }
+
+private:
+    IioMagCalibrator calibrator_;
+};
+
+template <typename T>
+IioFrameSink *createIioFrameSink(unsigned int size)
+{
+    return new IioRingBufferSink<T>(size);
+}
+
+template <>
+inline IioFrameSink *createIioFrameSink<CalibratedMagneticFieldData>(unsigned int size)
+{
+    return new IioMagnetometerSink(size);
+}
+
+#endif
@@ -0,0 +1,201 @@
+/**
+   @file iiotrace.cpp
+   @brief In-memory sample path trace ring for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <QFile>
+#include <QFileInfo>
+#include <QDir>
+#include <QTextStream>
+#include <QVector>
+#include <QSocketNotifier>
+#include <QCoreApplication>
+
+#include <logging.h>
+
+#include "iiotrace.h"
+
+#define IIO_TRACE_MAGIC             "IIOTRACE"
+#define IIO_TRACE_VERSION           2
+
+IioTrace::Record IioTrace::ring_[IIO_TRACE_EVENTS];
+QAtomicInt IioTrace::head_;
+
+static int dumpPipe[2] = { -1, -1 };
+
+static void dumpSignalHandler(int)
+{
+    char c = 1;
+    int savedErrno = errno;
+    if (::write(dumpPipe[1], &c, 1) < 0) {
+        // nothing to do in a signal handler
+    }
+    errno = savedErrno;
+}
+
+static const char *eventName(int event)
+{
+    switch (event) {
+    case IioTrace::Read:
+        return "read";
+    case IioTrace::Refill:
+        return "refill";
+    case IioTrace::Decode:
+        return "decode";
+    case IioTrace::Commit:
+        return "commit";
+    case IioTrace::WakeUp:
+        return "wakeup";
+    case IioTrace::Error:
+        return "error";
+    default:
+        return "unknown";
+    }
+}
+
+/*
+ * Create the dump file afresh. Unlinking first and then opening with
+ * O_EXCL | O_NOFOLLOW means a planted symlink is removed instead of
+ * followed, so the daemon never writes through it.
+ */
+static bool openDumpFile(QFile *file, const QString &path, QIODevice::OpenMode mode)
+{
+    QByteArray name = path.toLocal8Bit();
+
+    // The default location is the state directory, which may not exist yet
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    if (unlink(name.constData()) < 0 && errno != ENOENT) {
+        sensordLogW() << "unlink(" << path << "):" << strerror(errno);
+        return false;
+    }
+
+    int fd = ::open(name.constData(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        sensordLogW() << "Failed to open " << path << ":" << strerror(errno);
+        return false;
+    }
+
+    if (!file->open(fd, mode, QFileDevice::AutoCloseHandle)) {
+        ::close(fd);
+        sensordLogW() << "Failed to open " << path;
+        return false;
+    }
+    return true;
+}
+
+// Copy the ring oldest first, return the number of records
+int IioTrace::snapshot(Record *out)
+{
+    unsigned int head = head_.loadAcquire();
+    unsigned int count = qMin(head, (unsigned int)IIO_TRACE_EVENTS);
+
+    for (unsigned int i = 0; i < count; ++i)
+        out[i] = ring_[(head - count + i) & (IIO_TRACE_EVENTS - 1)];
+
+    return count;
+}
+
+bool IioTrace::dump(const QString &path)
+{
+    QVector<Record> records(IIO_TRACE_EVENTS);
+    quint32 count = snapshot(records.data());
+    quint32 version = IIO_TRACE_VERSION;
+
+    QFile file;
+    if (!openDumpFile(&file, path, QIODevice::WriteOnly))
+        return false;
+
+    file.write(IIO_TRACE_MAGIC, 8);
+    file.write(reinterpret_cast<const char *>(&version), sizeof(version));
+    file.write(reinterpret_cast<const char *>(&count), sizeof(count));
+    file.write(reinterpret_cast<const char *>(records.constData()), count * sizeof(Record));
+    file.close();
+
+    return file.error() == QFile::NoError;
+}
+
+bool IioTrace::dumpChromeTrace(const QString &path)
+{
+    QVector<Record> records(IIO_TRACE_EVENTS);
+    int count = snapshot(records.data());
+
+    QFile file;
+    if (!openDumpFile(&file, path, QIODevice::WriteOnly | QIODevice::Text))
+        return false;
+
+    QTextStream out(&file);
+    out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    for (int i = 0; i < count; ++i) {
+        const Record &r = records.at(i);
+        out << (i ? ",\n" : "")
+            << "{\"name\":\"" << eventName(r.event) << "\",\"ph\":\"i\",\"s\":\"t\""
+            << ",\"ts\":" << QString::number(r.timestamp / 1000.0, 'f', 3)
+            << ",\"pid\":" << r.device
+            << ",\"tid\":" << r.channel
+            << ",\"args\":{\"value\":" << r.value << "}}";
+    }
+    out << "\n]}\n";
+    out.flush();
+    file.close();
+
+    return file.error() == QFile::NoError;
+}
+
+bool IioTrace::installDumpSignal(int signum, const QString &path)
+{
+    if (dumpPipe[0] != -1 || signum <= 0)
+        return false;
+
+    if (pipe2(dumpPipe, O_CLOEXEC | O_NONBLOCK) < 0) {
+        sensordLogW() << "pipe2():" << strerror(errno);
+        return false;
+    }
+
+    // Dumping happens in the main thread, the handler only pokes the pipe
+    QSocketNotifier *notifier = new QSocketNotifier(dumpPipe[0], QSocketNotifier::Read,
+                                                    QCoreApplication::instance());
+    QObject::connect(notifier, &QSocketNotifier::activated, [path](int fd) {
+        char buf[16];
+        while (::read(fd, buf, sizeof(buf)) > 0)
+            ;
+        IioTrace::dump(path + ".bin");
+        IioTrace::dumpChromeTrace(path + ".json");
+        sensordLogD() << "iio trace written to" << path;
+    });
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = dumpSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    if (sigaction(signum, &action, NULL) < 0) {
+        sensordLogW() << "sigaction():" << strerror(errno);
+        return false;
+    }
+
+    return true;
+}
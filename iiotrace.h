@@ -0,0 +1,97 @@
+/**
+   @file iiotrace.h
+   @brief In-memory sample path trace ring for IioAdaptor
+
+   <p>
+   Copyright (C) 2026 agent
+
+   @author agent <agent@local>
+
+   Sensord is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License
+   version 2.1 as published by the Free Software Foundation.
+
+   Sensord is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with Sensord.  If not, see <http://www.gnu.org/licenses/>.
+   </p>
+*/
+
+#ifndef IIOTRACE_H
+#define IIOTRACE_H
+
+#include <time.h>
+
+#include <QAtomicInt>
+#include <QString>
+
+// Number of events kept, must be a power of two
+#define IIO_TRACE_EVENTS            4096
+
+/**
+ * @brief Always-on trace of the sample path.
+ *
+ * Every read, decode, commit and wakeup appends a 16 byte record to a
+ * fixed size ring shared by all adaptors. Appending is one relaxed
+ * atomic increment and a monotonic clock read, so it can stay enabled
+ * in production. The ring is written out with #dump() (raw records) and
+ * #dumpChromeTrace() (JSON loadable in chrome://tracing or Perfetto),
+ * or on a signal set up with #installDumpSignal().
+ *
+ * Records being written while a dump runs may come out torn; the dump
+ * is a forensic snapshot, not a consistent log.
+ */
+class IioTrace
+{
+public:
+    enum Event {
+        Read = 1,   // sysfs channel read, value: bytes
+        Refill,     // iio_buffer_refill returned, value: bytes
+        Decode,     // frame decoded, value: channels
+        Commit,     // frame handed to the sink, value: channels
+        WakeUp,     // readers woken, value: 0
+        Error       // failed read or refill, value: errno
+    };
+
+    struct Record {
+        quint64 timestamp;  // CLOCK_MONOTONIC, ns
+        quint16 device;
+        quint8 channel;
+        quint8 event;
+        quint32 value;
+    };
+
+    static inline void record(Event event, int device, int channel, quint32 value = 0)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        Record &r = ring_[head_.fetchAndAddRelaxed(1) & (IIO_TRACE_EVENTS - 1)];
+        r.timestamp = quint64(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+        r.device = device;
+        r.channel = channel;
+        r.event = event;
+        r.value = value;
+    }
+
+    static bool dump(const QString &path);
+    static bool dumpChromeTrace(const QString &path);
+
+    /**
+     * Dump to @e path.bin and @e path.json whenever @e signum arrives.
+     * Only the first call installs a handler.
+     */
+    static bool installDumpSignal(int signum, const QString &path);
+
+private:
+    static int snapshot(Record *out);
+
+    static Record ring_[IIO_TRACE_EVENTS];
+    static QAtomicInt head_;
+};
+
+#endif